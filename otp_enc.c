@@ -8,6 +8,8 @@
  * 		the plaintext to be encrypted, key is the encryption key that will be used to encrypt
  * 		the text, and port is the port that otp_enc should try to connect to otp_enc_d on.
  *
+ * 		Pass --legacy to talk to daemons that only understand the old "@@@" protocol.
+ *
  */
 
 #include <string.h>
@@ -27,11 +29,13 @@
 #include <sys/wait.h>
 #include <dirent.h>
 #include <signal.h>
-int validate(int argc, char* argv[]);
+#include <getopt.h>
+
+#include "otp_proto.h"
+
+int validate(int argc, char* argv[], int* wire);
 int connect_to(char* hostname, char* portnum);
 char* readFile(char* file_name, int* length);
-int send_to(int socket, char* message);
-char* receiveStream(int socket);
 void error(const char *msg) { perror(msg); exit(0); } /* Error function used for reporting issues*/
 
 int main(int argc, char* argv[]) {
@@ -43,6 +47,8 @@ int main(int argc, char* argv[]) {
 	char* key_name;
 	char* key;
 	char* status;
+	int status_type;
+	int wire;
 
 	int plaintext_length = 0;
 	int key_length = 0;
@@ -50,7 +56,7 @@ int main(int argc, char* argv[]) {
 	int socket;
 
 	/*First check that format of command line args is correct */
-	valid = validate(argc, argv);
+	valid = validate(argc, argv, &wire);
 	if(valid == 0) {
 		perror("Invalid command line arguments\n");
 		exit(3);
@@ -60,9 +66,9 @@ int main(int argc, char* argv[]) {
 	/*Open the files for reading and check their length. Don't include the newline at the
  * 		end of the file */
 	/*NOTE: ALL FILES USED HAVE TERMINATING NEWLINES */
-	plaintext_name = argv[1];
+	plaintext_name = argv[optind];
 	plaintext = readFile(plaintext_name, &plaintext_length);
-	key_name = argv[2];
+	key_name = argv[optind + 1];
 	key = readFile(key_name, &key_length);
 	if(key_length < plaintext_length) {
 		fprintf(stderr, "Error: key '%s' is too short\n", key_name);
@@ -70,7 +76,7 @@ int main(int argc, char* argv[]) {
 	}
 
 	/*Now that we know the command line arguments are valid, attempt to connect */
-	port = argv[3];
+	port = argv[optind + 2];
 	socket = connect_to("localhost", port);
 	if(socket < 0) {
 		/*Failure to connect */
@@ -81,12 +87,15 @@ int main(int argc, char* argv[]) {
 	}
 
 	/*First verify identity with the daemon */
-	send_to(socket, "otp_enc");
-	send_to(socket, "@@@");
-	sleep(1);
+	if(negotiate_wire(socket, wire) < 0) {
+		error("CLIENT: ERROR sending negotiation byte");
+	}
+	send_message(socket, wire, OTP_FRAME_HELLO, "otp_enc", 7);
 
-	status = receiveStream(socket);
-	if( strcmp(status, "BAD") == 0) {
+	/*The daemon's GOOD or BAD answer is the acknowledgement; no need to wait any longer */
+
+	status = receive_message(socket, wire, &status_type, NULL);
+	if(status == NULL || status_type == OTP_FRAME_BAD || strcmp(status, "BAD") == 0) {
 		fprintf(stderr, "Error: could not contact otp_enc_d on port %s\n", port);	
 		free(status);
 		free(plaintext);
@@ -99,15 +108,22 @@ int main(int argc, char* argv[]) {
 
 	/*Now that we have VERIFIED connection to the daemon, send the files over to
  * 		the daemon for encryption */
-	send_to(socket, plaintext); 
-	send_to(socket, "@@@");
-	sleep(1);
+	send_message(socket, wire, OTP_FRAME_DATA, plaintext, plaintext_length); 
+
+	/*Daemons from before the framed protocol lose whatever follows the first "@@@"
+ * 		in a single read, so give them a moment to finish reading the message */
+	if(wire == OTP_WIRE_LEGACY) { sleep(1); }
 	
-	send_to(socket, key);
-	send_to(socket, "@@@");
-	sleep(1);
+	send_message(socket, wire, OTP_FRAME_KEY, key, key_length);
 
-	ciphertext = receiveStream(socket);
+	/*Nothing else will be sent, so tell the daemon by half-closing the connection */
+	shutdown(socket, SHUT_WR);
+
+	ciphertext = receive_message(socket, wire, NULL, NULL);
+	if(ciphertext == NULL) {
+		fprintf(stderr, "Error: otp_enc_d on port %s closed the connection\n", port);
+		exit(2);
+	}
 	printf("%s\n", ciphertext);
 
 	/*Clean up resources: heap and sockets */
@@ -121,93 +137,6 @@ int main(int argc, char* argv[]) {
 	return 0;
 }
 
-/* receiveStream: receives bytes from a socket
- * args: [1] socket representing TCP socket connected to another tcp socket
- * pre: socket should already be connected. A single stream is ended by the ending
- * 	sequence "@@@" that is sent by the sender
- * ret: char* to dynamically allocated memory holding the received message
- * post: the stream does not include the "@@@" terminating sequence
- 	Caller will need to free returned string */
-char* receiveStream(int socket) {
-	char* buffer = NULL;
-	char* start = NULL;
-	int bytesRead = 0;
-	int totalBytes = 0;
-	int bufferlen = 1024;
-
-	int index;
-
-	buffer = malloc(bufferlen * sizeof(char));
-	start = buffer;
-	memset(start, '\0', bufferlen);
-	while( totalBytes < bufferlen) {
-		/*Put start at the next available space */
-		start = buffer + totalBytes;
-		
-		/*Read memory until 3 null terminators left */
-		bytesRead = recv(socket, start, bufferlen - totalBytes - 5, 0);
-		totalBytes = totalBytes + bytesRead;
-
-		/*If the terminating characters are received, we are done */
-		if(strstr(start, "@@@") != NULL ){
-			break;
-
-		}
-
-		/*If over half the buffer has been used, reallocate memory */
-		if(totalBytes > (bufferlen / 2)  ) {
-			bufferlen = bufferlen * 2;
-			buffer = realloc(buffer, bufferlen);
-
-			/*Null terminate the rest of the string */
-			start = buffer + totalBytes;
-			memset(start, '\0', bufferlen - totalBytes - 2); /*Off by one error? */
-		}
-	}	
-
-	/*Now that we've read all the bytes for this stream,
- * 		strip off null terminator and return pointer to the result */
-	start = strstr(start, "@@@");
-	for(index = 0; index < 3; index++) {
-		start[index] = '\0';
-	}
-	return buffer;
-}
-
-
-/* send_to: function for sending an entire string into a socket
- * args: [1] socket: a file descriptor to an opened tcp connection
- * 	[2] message: string to send through the socket
- * pre: socket should be valid and opened
- * ret: int: -1 if error occured; 0 otherwise
- * post: entire message will have been sent into socket  
- *
- *  	Citation: Borrowed largely from Beej's guide */
-int send_to(int socket, char* message) {
-	/*FOR ALL RECEIVING FUNCTIONS, NEED TO STRIP OFF THE TERMINATING SPACES
- * 		AND TERMINATING @@@ code!!! */
-	/*REALLY IMPORTANT<<< THE TERMINATORS ARE NOT PART OF THE MESSAGE */
-	int total = 0;
-	int bytesleft;
-	int length;
-	int n;
-
-	length = strlen(message);
-	bytesleft = length;
-
-	/*While the total number of bytes sent is not the length of the message
- * 		keep sending the remaining bytes */
-	while(total < length) {
-		n = send(socket, message + total, bytesleft, 0);
-		if( n == -1) { break; } /* -1 is returned if an error occurred*/
-		total += n;
-		bytesleft -= n;
-	}
-
-	if( n == -1) { perror("Problem sending\n"); return -1; }
-	else { return 0; }
-}
-
 /* readFile: reads in a text file and keeps track of its length (not including terminating newline)
  * args: [1] file_name: name of the file to open for reading
  * 	[2] length: pointer to an int to store the length of the file
@@ -311,18 +240,32 @@ int connect_to(char* hostname, char* portnum) {
 }
 
 /*Attempt to validate the command line parameters */
-/*Checks that there are 4 total command line parameters, an that the 4th one
+/*Parses the options (--legacy selects the old "@@@" protocol and stores it in wire),
+ * then checks that there are 3 positional parameters left, and that the 3rd one
  * can be converted to an integer. Returns 0 if it discovers the above
- * conditions do not hold; otherwise returns 1 */
-int validate(int argc, char* argv[]) {
+ * conditions do not hold; otherwise returns 1. On success the positional
+ * parameters start at argv[optind] */
+int validate(int argc, char* argv[], int* wire) {
+	static struct option options[] = {
+		{ "legacy", no_argument, NULL, 'l' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+
+	*wire = OTP_WIRE_V1;
+	while((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		if(opt == 'l') { *wire = OTP_WIRE_LEGACY; }
+		else { return 0; }
+	}
+
 	/*First, check that the command lines are correct */
-	if(argc != 4) {
+	if(argc - optind != 3) {
 		perror("Incorrect number of arguments. Need 3\n");
 		return 0;
 	}
 
 	/*Next, check that the port number can actually be parsed as an int */
-	if(atoi(argv[3]) == 0) {
+	if(atoi(argv[optind + 2]) == 0) {
 		return 0;
 	}
 	return 1;
@@ -0,0 +1,152 @@
+/* Filename: otp_epoll.c
+ * Author: Howard Chen
+ * Date: 8-9-2017
+ * Description: The --engine=epoll accept loop for otp_enc_d and otp_dec_d. A single
+ * 		process keeps every connection's socket non-blocking and advances its
+ * 		session (see otp_session.h) whenever epoll reports the socket ready. No
+ * 		processes are forked and nothing has to be reaped.
+ */
+
+#define _GNU_SOURCE /*for accept4 */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "otp_server.h"
+
+#define MAX_EVENTS 256
+
+/* One accepted client, and the epoll events it is currently registered for */
+struct connection {
+	struct session session;
+	uint32_t events;
+};
+
+/* drive: advances a connection's session and updates its epoll registration
+ * args: [1] epfd: the epoll instance
+ * 	[2] conn: the connection whose socket became ready
+ * pre: conn is registered with epfd
+ * ret: 1 if the connection finished and was released; 0 otherwise
+ * post: a finished connection's socket is closed and conn is freed
+ */
+static int drive(int epfd, struct connection* conn) {
+	struct epoll_event event;
+	uint32_t wanted;
+	int status;
+
+	status = session_step(&conn->session);
+	if(status == SESSION_FINISHED) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, conn->session.socket, NULL);
+		close(conn->session.socket);
+		session_free(&conn->session);
+		free(conn);
+		return 1;
+	}
+
+	/*Only touch the registration when the direction changes */
+	wanted = status == SESSION_WANT_WRITE ? EPOLLOUT : EPOLLIN;
+	if(wanted != conn->events) {
+		event.events = wanted;
+		event.data.ptr = conn;
+		if(epoll_ctl(epfd, EPOLL_CTL_MOD, conn->session.socket, &event) < 0) {
+			perror("epoll_ctl");
+		}
+		conn->events = wanted;
+	}
+	return 0;
+}
+
+/* accept_ready: accepts every connection waiting on the listening socket
+ * args: [1] epfd: the epoll instance
+ * 	[2] server: the non-blocking listening socket
+ * 	[3] service: what the new sessions do
+ * pre: server is registered with epfd
+ * ret: 0 normally; -1 if the process ran out of file descriptors
+ * post: every new connection is registered for EPOLLIN
+ */
+static int accept_ready(int epfd, int server, const struct service* service) {
+	struct connection* conn;
+	struct epoll_event event;
+	int client;
+
+	while(1) {
+		client = accept4(server, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(client < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) { continue; }
+			if(errno == EMFILE || errno == ENFILE) { return -1; }
+			return 0; /*EAGAIN: the backlog is empty */
+		}
+
+		conn = malloc(sizeof(*conn));
+		if(conn == NULL) { close(client); continue; }
+		session_init(&conn->session, client, service);
+		conn->events = EPOLLIN;
+
+		event.events = EPOLLIN;
+		event.data.ptr = conn;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, client, &event) < 0) {
+			perror("epoll_ctl");
+			session_free(&conn->session);
+			free(conn);
+			close(client);
+		}
+	}
+}
+
+/* serve_epoll: the event loop behind --engine=epoll
+ * args: [1] server: listening socket
+ * 	[2] service: what to do with the clients
+ * pre: server is listening
+ * ret: none; this function only returns if the process is killed
+ * post: none
+ */
+void serve_epoll(int server, const struct service* service) {
+	struct epoll_event events[MAX_EVENTS];
+	struct epoll_event event;
+	int epfd;
+	int count;
+	int index;
+	int accepting = 1;
+
+	fcntl(server, F_SETFL, fcntl(server, F_GETFL) | O_NONBLOCK);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd < 0) { error("ERROR creating epoll instance"); }
+
+	/*The listening socket is the only registration with a NULL pointer */
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, server, &event) < 0) { error("ERROR registering listener"); }
+
+	while(1) {
+		count = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if(count < 0) {
+			if(errno == EINTR) { continue; }
+			error("ERROR waiting for events");
+		}
+
+		for(index = 0; index < count; index++) {
+			if(events[index].data.ptr == NULL) {
+				/*Out of descriptors: stop listening until a connection closes,
+ * 					otherwise the level-triggered listener would spin */
+				if(accept_ready(epfd, server, service) < 0) {
+					epoll_ctl(epfd, EPOLL_CTL_DEL, server, NULL);
+					accepting = 0;
+				}
+			}
+			else if(drive(epfd, events[index].data.ptr) && !accepting) {
+				event.events = EPOLLIN;
+				event.data.ptr = NULL;
+				epoll_ctl(epfd, EPOLL_CTL_ADD, server, &event);
+				accepting = 1;
+			}
+		}
+	}
+}
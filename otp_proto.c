@@ -0,0 +1,301 @@
+/* Filename: otp_proto.c
+ * Author: Howard Chen
+ * Date: 8-9-2017
+ * Description: Sending and receiving messages for the otp programs. Implements both the
+ * 		length-prefixed frames of the current protocol and the "@@@"-terminated
+ * 		strings of the legacy protocol. See otp_proto.h for the frame layout.
+ */
+
+#define _GNU_SOURCE /*for memmem */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "otp_proto.h"
+
+/* encode_header: writes a frame header into its 12 byte wire representation
+ * args: [1] out: buffer of at least OTP_FRAME_HEADER_LEN bytes
+ * 	[2] header: header to encode
+ * pre: none
+ * ret: none
+ * post: out holds the big-endian encoding of header
+ */
+void encode_header(unsigned char out[], const struct frame_header* header) {
+	int index;
+
+	out[0] = header->version;
+	out[1] = header->type;
+	out[2] = (header->flags >> 8) & 0xFF;
+	out[3] = header->flags & 0xFF;
+	for(index = 0; index < 8; index++) {
+		out[4 + index] = (header->length >> (56 - 8 * index)) & 0xFF;
+	}
+}
+
+/* decode_header: reads a frame header from its 12 byte wire representation
+ * args: [1] in: buffer of OTP_FRAME_HEADER_LEN bytes received from a socket
+ * 	[2] header: where to store the decoded header
+ * pre: none
+ * ret: 0 if the header is valid; -1 if the version is unknown or the length is too big
+ * post: header holds the decoded fields
+ */
+int decode_header(const unsigned char in[], struct frame_header* header) {
+	int index;
+
+	header->version = in[0];
+	header->type = in[1];
+	header->flags = (in[2] << 8) | in[3];
+	header->length = 0;
+	for(index = 0; index < 8; index++) {
+		header->length = (header->length << 8) | in[4 + index];
+	}
+
+	if(header->version != OTP_PROTO_VERSION || header->length > OTP_FRAME_MAX_LEN) {
+		return -1;
+	}
+	return 0;
+}
+
+/* send_all: sends exactly length bytes into a socket
+ * args: [1] socket: a file descriptor to an opened tcp connection
+ * 	[2] buffer: bytes to send
+ * 	[3] length: number of bytes to send
+ * pre: socket should be valid and opened
+ * ret: int: -1 if error occured; 0 otherwise
+ * post: entire buffer will have been sent into socket
+ *
+ *  	Citation: Borrowed largely from Beej's guide */
+int send_all(int socket, const char* buffer, size_t length) {
+	size_t total = 0;
+	ssize_t n;
+
+	while(total < length) {
+		n = send(socket, buffer + total, length - total, MSG_NOSIGNAL);
+		if(n == -1) {
+			if(errno == EINTR) { continue; }
+			return -1;
+		}
+		total += n;
+	}
+	return 0;
+}
+
+/* recv_all: receives exactly length bytes from a socket
+ * args: [1] socket: a file descriptor to an opened tcp connection
+ * 	[2] buffer: where to store the bytes, at least length bytes long
+ * 	[3] length: number of bytes to receive
+ * pre: socket should be valid and opened
+ * ret: int: -1 if an error occured or the peer closed the connection early; 0 otherwise
+ * post: buffer holds the next length bytes of the stream
+ */
+int recv_all(int socket, char* buffer, size_t length) {
+	size_t total = 0;
+	ssize_t n;
+
+	while(total < length) {
+		n = recv(socket, buffer + total, length - total, 0);
+		if(n == 0) { return -1; }
+		if(n == -1) {
+			if(errno == EINTR) { continue; }
+			return -1;
+		}
+		total += n;
+	}
+	return 0;
+}
+
+/* send_frame: sends a single frame into a socket
+ * args: [1] socket: a file descriptor to an opened tcp connection
+ * 	[2] type: one of the OTP_FRAME_* types
+ * 	[3] flags: frame flags
+ * 	[4] payload: bytes of the frame body
+ * 	[5] length: number of bytes in payload
+ * pre: the connection should have negotiated OTP_WIRE_V1
+ * ret: int: -1 if error occured; 0 otherwise
+ * post: header and payload will have been sent into socket
+ */
+int send_frame(int socket, int type, int flags, const char* payload, size_t length) {
+	struct frame_header header;
+	unsigned char encoded[OTP_FRAME_HEADER_LEN];
+
+	header.version = OTP_PROTO_VERSION;
+	header.type = type;
+	header.flags = flags;
+	header.length = length;
+	encode_header(encoded, &header);
+
+	if(send_all(socket, (char*)encoded, OTP_FRAME_HEADER_LEN) < 0) { return -1; }
+	return send_all(socket, payload, length);
+}
+
+/* recv_frame: receives a single frame from a socket
+ * args: [1] socket: a file descriptor to an opened tcp connection
+ * 	[2] header: where to store the received frame header
+ * pre: the connection should have negotiated OTP_WIRE_V1
+ * ret: char* to dynamically allocated memory holding the payload, or NULL on error
+ * post: the payload buffer is allocated once, at exactly the announced length plus a
+ * 	null terminator. Caller will need to free returned string
+ */
+char* recv_frame(int socket, struct frame_header* header) {
+	unsigned char encoded[OTP_FRAME_HEADER_LEN];
+	char* payload;
+
+	if(recv_all(socket, (char*)encoded, OTP_FRAME_HEADER_LEN) < 0) { return NULL; }
+	if(decode_header(encoded, header) < 0) { return NULL; }
+
+	payload = malloc(header->length + 1);
+	if(payload == NULL) { return NULL; }
+	if(recv_all(socket, payload, header->length) < 0) {
+		free(payload);
+		return NULL;
+	}
+	payload[header->length] = '\0';
+	return payload;
+}
+
+/* send_to: function for sending an entire string into a socket
+ * args: [1] socket: a file descriptor to an opened tcp connection
+ * 	[2] message: string to send through the socket
+ * pre: socket should be valid and opened
+ * ret: int: -1 if error occured; 0 otherwise
+ * post: entire message will have been sent into socket. The "@@@" terminator of the
+ * 	legacy protocol is NOT added; callers send it separately
+ */
+int send_to(int socket, char* message) {
+	return send_all(socket, message, strlen(message));
+}
+
+/* receiveStream: receives bytes from a socket
+ * args: [1] socket representing TCP socket connected to another tcp socket
+ * pre: socket should already be connected. A single stream is ended by the ending
+ * 	sequence "@@@" that is sent by the sender
+ * ret: char* to dynamically allocated memory holding the received message, or NULL if
+ * 	the connection closed before the terminator arrived
+ * post: the stream does not include the "@@@" terminating sequence
+ 	Caller will need to free returned string */
+char* receiveStream(int socket) {
+	char* buffer = NULL;
+	char* grown;
+	char* end;
+	size_t totalBytes = 0;
+	size_t bufferlen = 1024;
+	size_t scan;
+	ssize_t bytesRead;
+
+	buffer = malloc(bufferlen * sizeof(char));
+	if(buffer == NULL) { return NULL; }
+
+	while(1) {
+		/*Keep at least half a kilobyte free for the next read */
+		if(bufferlen - totalBytes < 512) {
+			bufferlen = bufferlen * 2;
+			grown = realloc(buffer, bufferlen);
+			if(grown == NULL) { free(buffer); return NULL; }
+			buffer = grown;
+		}
+
+		bytesRead = recv(socket, buffer + totalBytes, bufferlen - totalBytes - 1, 0);
+		if(bytesRead <= 0) {
+			if(bytesRead == -1 && errno == EINTR) { continue; }
+			free(buffer);
+			return NULL;
+		}
+
+		/*Only scan the new bytes, plus the last two old ones in case the
+ * 			terminator was split across two reads */
+		scan = totalBytes > 2 ? totalBytes - 2 : 0;
+		totalBytes = totalBytes + bytesRead;
+		end = memmem(buffer + scan, totalBytes - scan, "@@@", 3);
+		if(end != NULL) {
+			/*Strip off the terminator and return pointer to the result */
+			*end = '\0';
+			return buffer;
+		}
+	}
+}
+
+/* negotiate_wire: sends the client's negotiation byte
+ * args: [1] socket: a freshly connected socket
+ * 	[2] wire: OTP_WIRE_V1 or OTP_WIRE_LEGACY
+ * pre: nothing else has been sent on the socket yet
+ * ret: int: -1 if error occured; 0 otherwise
+ * post: for OTP_WIRE_V1 the daemon will expect frames from now on. For OTP_WIRE_LEGACY
+ * 	nothing is sent, which is exactly what the old clients did
+ */
+int negotiate_wire(int socket, int wire) {
+	char version = OTP_WIRE_V1;
+
+	if(wire == OTP_WIRE_LEGACY) { return 0; }
+	return send_all(socket, &version, 1);
+}
+
+/* detect_wire: works out which protocol a newly accepted client speaks
+ * args: [1] socket: a freshly accepted socket
+ * pre: nothing has been read from the socket yet
+ * ret: OTP_WIRE_V1 or OTP_WIRE_LEGACY, or -1 if the client went away
+ * post: the negotiation byte, if any, is consumed. Legacy bytes are left in the socket
+ */
+int detect_wire(int socket) {
+	char first;
+	ssize_t n;
+
+	do {
+		n = recv(socket, &first, 1, MSG_PEEK);
+	} while(n == -1 && errno == EINTR);
+	if(n <= 0) { return -1; }
+
+	if(first != OTP_WIRE_V1) { return OTP_WIRE_LEGACY; }
+	if(recv_all(socket, &first, 1) < 0) { return -1; }
+	return OTP_WIRE_V1;
+}
+
+/* send_message: sends one message using whichever protocol the connection speaks
+ * args: [1] socket: a connected socket
+ * 	[2] wire: OTP_WIRE_V1 or OTP_WIRE_LEGACY
+ * 	[3] type: OTP_FRAME_* type of the message; ignored by the legacy protocol
+ * 	[4] message: bytes to send
+ * 	[5] length: number of bytes in message
+ * pre: legacy messages must not contain "@@@" or null bytes
+ * ret: int: -1 if error occured; 0 otherwise
+ * post: the message and its framing have been sent
+ */
+int send_message(int socket, int wire, int type, const char* message, size_t length) {
+	if(wire == OTP_WIRE_V1) {
+		return send_frame(socket, type, 0, message, length);
+	}
+
+	if(send_all(socket, message, length) < 0) { return -1; }
+	return send_all(socket, "@@@", 3);
+}
+
+/* receive_message: receives one message using whichever protocol the connection speaks
+ * args: [1] socket: a connected socket
+ * 	[2] wire: OTP_WIRE_V1 or OTP_WIRE_LEGACY
+ * 	[3] type: where to store the OTP_FRAME_* type; legacy messages report 0. May be NULL
+ * 	[4] length: where to store the payload length. May be NULL
+ * pre: none
+ * ret: char* to dynamically allocated, null terminated payload, or NULL on error
+ * post: Caller will need to free returned string
+ */
+char* receive_message(int socket, int wire, int* type, size_t* length) {
+	struct frame_header header;
+	char* message;
+
+	if(wire == OTP_WIRE_V1) {
+		message = recv_frame(socket, &header);
+		if(message == NULL) { return NULL; }
+		if(type != NULL) { *type = header.type; }
+		if(length != NULL) { *length = header.length; }
+		return message;
+	}
+
+	message = receiveStream(socket);
+	if(message == NULL) { return NULL; }
+	if(type != NULL) { *type = 0; }
+	if(length != NULL) { *length = strlen(message); }
+	return message;
+}
@@ -0,0 +1,67 @@
+/* Filename: otp_proto.h
+ * Author: Howard Chen
+ * Date: 8-9-2017
+ * Description: The wire protocol shared by otp_enc, otp_dec, otp_enc_d and otp_dec_d.
+ *
+ * 		A client opens a connection by sending a single negotiation byte. If the byte is
+ * 		OTP_WIRE_V1, every message after it is a frame: a fixed 12 byte header followed by
+ * 		exactly <length> payload bytes. Any other first byte means the client speaks the
+ * 		old protocol, where every message is a string terminated by "@@@".
+ *
+ * 		Frame header layout (all integers are big-endian):
+ * 			byte  0      version (OTP_PROTO_VERSION)
+ * 			byte  1      type (one of OTP_FRAME_*)
+ * 			bytes 2-3    flags
+ * 			bytes 4-11   payload length
+ */
+
+#ifndef OTP_PROTO_H
+#define OTP_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTP_PROTO_VERSION 1
+
+/*Wire modes. OTP_WIRE_V1 is also the negotiation byte sent by the client */
+#define OTP_WIRE_LEGACY 0
+#define OTP_WIRE_V1 0x01
+
+#define OTP_FRAME_HEADER_LEN 12
+
+/*Refuse to allocate for frames that announce an absurd length */
+#define OTP_FRAME_MAX_LEN ((uint64_t)1 << 36)
+
+/*Frame types */
+#define OTP_FRAME_HELLO 1	/*client identity, e.g. "otp_enc" */
+#define OTP_FRAME_GOOD 2	/*daemon accepted the client */
+#define OTP_FRAME_BAD 3		/*daemon rejected the client */
+#define OTP_FRAME_DATA 4	/*plaintext or ciphertext sent by the client */
+#define OTP_FRAME_KEY 5		/*key sent by the client */
+#define OTP_FRAME_RESULT 6	/*result of the encryption or decryption */
+
+struct frame_header {
+	uint8_t version;
+	uint8_t type;
+	uint16_t flags;
+	uint64_t length;
+};
+
+void encode_header(unsigned char out[], const struct frame_header* header);
+int decode_header(const unsigned char in[], struct frame_header* header);
+
+int send_all(int socket, const char* buffer, size_t length);
+int recv_all(int socket, char* buffer, size_t length);
+
+int send_frame(int socket, int type, int flags, const char* payload, size_t length);
+char* recv_frame(int socket, struct frame_header* header);
+
+int send_to(int socket, char* message);
+char* receiveStream(int socket);
+
+int negotiate_wire(int socket, int wire);
+int detect_wire(int socket);
+int send_message(int socket, int wire, int type, const char* message, size_t length);
+char* receive_message(int socket, int wire, int* type, size_t* length);
+
+#endif
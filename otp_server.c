@@ -0,0 +1,268 @@
+/* Filename: otp_server.c
+ * Author: Howard Chen
+ * Date: 8-9-2017
+ * Description: The parts of otp_enc_d and otp_dec_d that do not depend on which way the
+ * 		cipher runs: listening, accepting, forking a child per connection and cleaning
+ * 		up after the children. The child runs the protocol through otp_session.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h> 
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/wait.h>
+#include <getopt.h>
+
+#include "otp_server.h"
+#include "otp_session.h"
+
+/*Attempt to validate the command line parameters */
+/*Parses the options into options, then checks that exactly one positional parameter
+ * is left and that it can be converted to an integer. Returns 0 if it discovers the
+ * above conditions do not hold; otherwise returns 1 */
+int validate(int argc, char* argv[], struct daemon_options* options) {
+	static struct option long_options[] = {
+		{ "engine", required_argument, NULL, 'e' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+
+	memset(options, '\0', sizeof(*options));
+	options->engine = ENGINE_FORK;
+
+	while((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch(opt) {
+		case 'e':
+			if(strcmp(optarg, "fork") == 0) { options->engine = ENGINE_FORK; }
+			else if(strcmp(optarg, "epoll") == 0) { options->engine = ENGINE_EPOLL; }
+			else {
+				fprintf(stderr, "Unknown engine '%s'\n", optarg);
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if(argc - optind != 1) {
+		return 0;
+	}
+	/*Check that the port can be casted as an integer */
+	if(atoi(argv[optind]) == 0) {
+		return 0;
+	}
+	options->port = argv[optind];
+	return 1;
+}
+
+/* serve: runs the accept loop selected by the command line options
+ * args: [1] server: listening socket
+ * 	[2] service: what to do with the clients
+ * 	[3] options: parsed command line options
+ * pre: server is listening
+ * ret: none; this function only returns if the process is killed
+ * post: none
+ */
+void serve(int server, const struct service* service, const struct daemon_options* options) {
+	if(options->engine == ENGINE_EPOLL) {
+		serve_epoll(server, service);
+	} else {
+		serve_fork(server, service);
+	}
+}
+
+/* serve_fork: the daemon's main loop. Accepts connections and hands each one to a
+ * 		child process, keeping at most MAX_PROC children alive
+ * args: [1] server: listening socket
+ * 	[2] service: what the children do with their clients
+ * pre: server is listening
+ * ret: none; this function only returns if the process is killed
+ * post: none
+ */
+void serve_fork(int server, const struct service* service) {
+	int client;
+	int process_count = 0;	
+
+	while(1) {
+		if(process_count < MAX_PROC) {
+			/*If there's room, accept a new connection */
+			client = accept_connection(server);
+			process_count++;
+
+			/*Take the socket, and start a child process to handle getting
+ * 				the message, running the cipher, sending back the result, and
+ * 				closing the socket */
+			process(client, service);
+		}
+		else { /*If the process limit is reached, block until you can
+				clean up at least 1  process */
+			block_cleanup(&process_count);
+
+		}
+		/*No matter what, check briefly if any processes are waiting to be cleaned up */
+		quick_cleanup(&process_count);
+	}
+}
+
+/* Process: forks off a child process to receive bytes from a socket, run the cipher
+ * 		on them and send them back to the client
+ * args: [1] socket: open socket file descriptor
+ * 	[2] service: which client to accept and which cipher to run
+ * pre: socket should be opened, and should either be communicating with otp_enc or otp_dec
+ * ret: none
+ * post: the result will be sent back to the client, or if the client is the wrong
+ * 	program it will be informed that it has been rejected. The parent's copy of
+ * 	the socket is closed
+ */
+void process(int socket, const struct service* service) {
+	pid_t spawnpid = -5;
+	struct session session;
+
+	/*Spawn a new process to run the protocol with the client */
+	spawnpid = fork();
+
+	switch (spawnpid) {
+		case -1:
+			perror("Failure to spawn a process!\n"); fflush(stderr);
+			exit(1);
+			break;
+		case 0:
+			/*In child process: */
+			session_init(&session, socket, service);
+			session_run(&session);
+
+			/*Done with the client, so close the communication socket and
+ * 				end the child process */
+			session_free(&session);
+			close(socket);
+			exit(0);
+			break;
+		default:
+			/*In parent process: the child has its own copy of the socket */
+			close(socket);
+			break;
+	}
+
+	/*As parent, simply return */
+	return;
+}
+
+/* Description: checks for background processes that have terminated, and cleans up any
+ * 		that are zombies that are discovred. Does not block
+ * args: none
+ * pre: none
+ * post: any zombie child processes currently available will be cleaned up
+ * ret: none
+ */
+void quick_cleanup(int *process_count) {
+	int childPID = 5;
+	int childExitMethod = 5;
+
+	/*Clean up every terminated background process that is currently available*/
+	/*Don't block */
+	childPID = waitpid(-1, &childExitMethod, WNOHANG);
+	while(childPID != 0 && childPID != -1) {
+		if(*process_count > 0) { (*process_count)--; }
+		
+		/*Check if any more background processes can be cleaned up */
+		childPID = waitpid(-1, &childExitMethod, WNOHANG);
+	}
+	return;
+}
+
+/* Description: cleans up at least one child process, by blocking
+ * args: [1] process_count: pointer to an int that holds the number of child processes
+ * pre: process_count > 0, which means at least 1 child process exists to be cleand up.
+ * 	otherwise this function will block forever
+ * ret: none
+ * post: process_count will be decreased
+ */
+void block_cleanup(int *process_count) {
+	int exitMethod;
+	int childPID;
+
+	while( !(wait(&exitMethod) > 0)  ){
+		/*Wait until at least one child is cleaned up */	
+	}
+	if (*process_count > 0) { (*process_count)--; }
+
+	/*Check  if there are any more that need to be cleaned up */
+	childPID = waitpid(-1, &exitMethod, WNOHANG);
+	while(childPID != 0 && childPID != -1) {
+		if(*process_count > 0) {(*process_count)--; }
+
+		/*Check if any more background processes can be cleaned up */
+		childPID = waitpid(-1, &exitMethod, WNOHANG);
+	}
+}
+
+
+/* Description: uses a listening socket to accept a new connection, and returns the new socket
+ * args: [1] listenSocketFD: a file descriptor to a socket that is listening on some localhost port
+ * pre: listenSocketFD is a listening socket
+ * ret: a file descriptor to a new socket from a newly accepted client connection
+ * post: returned file descriptor must be closed by the caller at some point
+ *
+ * citation: from provided server.c file
+ */
+int accept_connection( int listenSocketFD)  {
+	int establishedConnectionFD; 
+	socklen_t sizeOfClientInfo;
+	struct sockaddr_in clientAddress;
+
+	/* Accept a connection, blocking if one is not available until one connects*/
+	sizeOfClientInfo = sizeof(clientAddress); /* Get the size of the address for the client that will connect*/
+	establishedConnectionFD = accept(listenSocketFD, (struct sockaddr *)&clientAddress, &sizeOfClientInfo); /* Accept*/
+	if (establishedConnectionFD < 0) { error("ERROR on accept"); } /*This error on accept should never happen */
+
+	return establishedConnectionFD;
+}
+
+/* Description: Returns a file descriptor to a socket that is listening on the specified port number
+ * Arguments: [1] port: string representation of the port number to listen on
+ * Pre: None
+ * Ret: a file descriptor to a socket
+ * Post: The file descriptor is open and listening, and will have to be closed by the caller
+ *
+ * citation: from provided server.c file
+ */
+int listen_on(char* port) {
+	int listenSocketFD; 
+	struct sockaddr_in serverAddress;
+	int portNumber;
+	int reuse = 1;
+
+	portNumber = atoi(port); /* Get the port number, convert to an integer from a string*/
+	/*Error check the port number */
+	if( portNumber == 0) {
+		error("Invalid port number\n");
+	}
+
+	/* Set up the address struct for this process (the server)*/
+	memset((char *)&serverAddress, '\0', sizeof(serverAddress)); /* Clear out the address struct*/
+	serverAddress.sin_family = AF_INET; /* Create a network-capable socket*/
+	serverAddress.sin_port = htons(portNumber); /* Store the port number*/
+	serverAddress.sin_addr.s_addr = INADDR_ANY; /* Any address is allowed for connection to this process*/
+
+
+	/* Set up the socket*/
+	listenSocketFD = socket(AF_INET, SOCK_STREAM, 0); /* Create the socket*/
+	if (listenSocketFD < 0) { error("ERROR opening socket"); }
+
+	/* The daemon closes first, so its old connections sit in TIME_WAIT; don't let them block a restart*/
+	setsockopt(listenSocketFD, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	/* Enable the socket to begin listening*/
+	if (bind(listenSocketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0) /* Connect socket to port*/
+	{	error("ERROR on binding");}
+	listen(listenSocketFD, 10); /* Flip the socket on - it can now receive up to 5 connections*/
+
+	/*Return a file descriptor to the listening socket */
+	return listenSocketFD;
+}
+
+void error(const char *msg) { perror(msg); exit(1); } /* Error function used for reporting issues*/
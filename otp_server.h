@@ -0,0 +1,35 @@
+/* Filename: otp_server.h
+ * Author: Howard Chen
+ * Date: 8-9-2017
+ * Description: Listening, accepting and process management shared by otp_enc_d and
+ * 		otp_dec_d.
+ */
+
+#ifndef OTP_SERVER_H
+#define OTP_SERVER_H
+
+#include "otp_session.h"
+
+#define MAX_PROC 5
+
+/*Ways of running the accept loop, chosen with --engine */
+#define ENGINE_FORK 0
+#define ENGINE_EPOLL 1
+
+struct daemon_options {
+	char* port;
+	int engine;
+};
+
+int validate(int argc, char* argv[], struct daemon_options* options);
+void serve(int server, const struct service* service, const struct daemon_options* options);
+void serve_fork(int server, const struct service* service);
+void serve_epoll(int server, const struct service* service);
+void process(int socket, const struct service* service);
+void quick_cleanup(int *process_count);
+void block_cleanup(int *process_count);
+int accept_connection( int listenSocketFD);
+int listen_on(char* port);
+void error(const char *msg);
+
+#endif
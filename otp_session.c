@@ -0,0 +1,471 @@
+/* Filename: otp_session.c
+ * Author: Howard Chen
+ * Date: 8-9-2017
+ * Description: The per-connection protocol state machine for the daemons. See
+ * 		otp_session.h for the states and how they connect.
+ */
+
+#define _GNU_SOURCE /*for memmem */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "otp_session.h"
+
+/*Result of a single read or write attempt */
+#define IO_DONE 1
+#define IO_AGAIN 0
+#define IO_FAILED -1
+
+/* reader_init: prepares a reader for a connection
+ * args: [1] reader: reader to initialize
+ * 	[2] wire: OTP_WIRE_V1 or OTP_WIRE_LEGACY
+ * pre: none
+ * ret: none
+ * post: reader is empty and must be released with reader_free()
+ */
+void reader_init(struct reader* reader, int wire) {
+	memset(reader, '\0', sizeof(*reader));
+	reader->wire = wire;
+}
+
+/* reader_free: releases anything a reader is still holding
+ * args: [1] reader: reader to release
+ * pre: reader was initialized with reader_init()
+ * ret: none
+ * post: any partially received message is discarded
+ */
+void reader_free(struct reader* reader) {
+	free(reader->buffer);
+	reader->buffer = NULL;
+	reader->length = 0;
+	reader->capacity = 0;
+}
+
+/* receive_some: one recv() call that sorts the outcome into IO_* codes
+ * args: [1] socket: connected socket
+ * 	[2] buffer: where to put the bytes
+ * 	[3] length: room in buffer
+ * 	[4] got: set to the number of bytes read
+ * pre: length > 0
+ * ret: IO_DONE if bytes arrived, IO_AGAIN if the socket has nothing yet,
+ * 	IO_FAILED on error or end of stream
+ * post: none
+ */
+static int receive_some(int socket, char* buffer, size_t length, size_t* got) {
+	ssize_t n;
+
+	do {
+		n = recv(socket, buffer, length, 0);
+	} while(n == -1 && errno == EINTR);
+
+	if(n > 0) { *got = n; return IO_DONE; }
+	if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return IO_AGAIN; }
+	return IO_FAILED;
+}
+
+/* next_frame: framed half of reader_next() */
+static int next_frame(struct reader* reader, int socket, char** message, size_t* length, int* type) {
+	size_t got;
+	int status;
+
+	/*First the fixed size header */
+	while(reader->header_got < OTP_FRAME_HEADER_LEN) {
+		status = receive_some(socket, (char*)reader->header + reader->header_got,
+			OTP_FRAME_HEADER_LEN - reader->header_got, &got);
+		if(status != IO_DONE) { return status; }
+		reader->header_got += got;
+
+		if(reader->header_got == OTP_FRAME_HEADER_LEN) {
+			if(decode_header(reader->header, &reader->frame) < 0) { return IO_FAILED; }
+
+			/*The length is known up front, so allocate exactly once */
+			reader->buffer = malloc(reader->frame.length + 1);
+			if(reader->buffer == NULL) { return IO_FAILED; }
+			reader->capacity = reader->frame.length + 1;
+			reader->length = 0;
+		}
+	}
+
+	/*Then exactly the announced number of payload bytes */
+	while(reader->length < reader->frame.length) {
+		status = receive_some(socket, reader->buffer + reader->length,
+			reader->frame.length - reader->length, &got);
+		if(status != IO_DONE) { return status; }
+		reader->length += got;
+	}
+
+	reader->buffer[reader->length] = '\0';
+	*message = reader->buffer;
+	*length = reader->length;
+	*type = reader->frame.type;
+
+	reader->buffer = NULL;
+	reader->length = 0;
+	reader->capacity = 0;
+	reader->header_got = 0;
+	return IO_DONE;
+}
+
+/* next_legacy: "@@@" half of reader_next(). Bytes that arrive after the terminator are
+ * 	kept for the next message, so a client that does not pause between messages
+ * 	loses nothing */
+static int next_legacy(struct reader* reader, int socket, char** message, size_t* length, int* type) {
+	char* end;
+	char* grown;
+	char* rest;
+	size_t got;
+	size_t start;
+	size_t leftover;
+	int status;
+
+	while(1) {
+		/*Only rescan the new bytes, plus two old ones in case the terminator was split */
+		start = reader->scanned > 2 ? reader->scanned - 2 : 0;
+		end = NULL;
+		if(reader->length > start) {
+			end = memmem(reader->buffer + start, reader->length - start, "@@@", 3);
+		}
+		reader->scanned = reader->length;
+
+		if(end != NULL) {
+			leftover = reader->length - (end - reader->buffer) - 3;
+			rest = NULL;
+			if(leftover > 0) {
+				rest = malloc(leftover + 1024);
+				if(rest == NULL) { return IO_FAILED; }
+				memcpy(rest, end + 3, leftover);
+			}
+
+			*end = '\0';
+			*message = reader->buffer;
+			*length = end - reader->buffer;
+			*type = 0;
+
+			reader->buffer = rest;
+			reader->length = leftover;
+			reader->capacity = rest == NULL ? 0 : leftover + 1024;
+			reader->scanned = 0;
+			return IO_DONE;
+		}
+
+		/*Keep at least half a kilobyte free for the next read */
+		if(reader->capacity - reader->length < 512) {
+			grown = realloc(reader->buffer, reader->capacity == 0 ? 1024 : reader->capacity * 2);
+			if(grown == NULL) { return IO_FAILED; }
+			reader->buffer = grown;
+			reader->capacity = reader->capacity == 0 ? 1024 : reader->capacity * 2;
+		}
+
+		status = receive_some(socket, reader->buffer + reader->length,
+			reader->capacity - reader->length - 1, &got);
+		if(status != IO_DONE) { return status; }
+		reader->length += got;
+	}
+}
+
+/* reader_next: receives as much of the next message as the socket has available
+ * args: [1] reader: the connection's reader
+ * 	[2] socket: connected socket, blocking or non-blocking
+ * 	[3] message: set to the heap allocated, null terminated message when complete
+ * 	[4] length: set to the message length when complete
+ * 	[5] type: set to the OTP_FRAME_* type when complete; 0 for legacy messages
+ * pre: reader was initialized for the connection's wire mode
+ * ret: 1 when a whole message was received, 0 if more bytes are needed and the
+ * 	socket has none right now, -1 on error or end of stream
+ * post: caller must free the returned message
+ */
+int reader_next(struct reader* reader, int socket, char** message, size_t* length, int* type) {
+	if(reader->wire == OTP_WIRE_V1) {
+		return next_frame(reader, socket, message, length, type);
+	}
+	return next_legacy(reader, socket, message, length, type);
+}
+
+/* queue_message: loads a message into the session's writer
+ * args: [1] session: the session
+ * 	[2] type: OTP_FRAME_* type of the message
+ * 	[3] payload: the message body
+ * 	[4] length: number of bytes in payload
+ * 	[5] owned: 1 if the writer should free payload once it is sent
+ * pre: the writer is empty
+ * ret: none
+ * post: the message and its framing wait in the writer until flushed
+ */
+static void queue_message(struct session* session, int type, char* payload, size_t length, int owned) {
+	struct writer* writer = &session->writer;
+	struct frame_header header;
+
+	memset(writer, '\0', sizeof(*writer));
+	writer->payload = payload;
+	writer->payload_length = length;
+	writer->owns_payload = owned;
+
+	if(session->wire == OTP_WIRE_V1) {
+		header.version = OTP_PROTO_VERSION;
+		header.type = type;
+		header.flags = 0;
+		header.length = length;
+		encode_header(writer->prefix, &header);
+		writer->prefix_length = OTP_FRAME_HEADER_LEN;
+	} else {
+		writer->suffix = "@@@";
+		writer->suffix_length = 3;
+	}
+}
+
+/* flush_writer: sends as much of the queued message as the socket accepts
+ * args: [1] session: the session
+ * pre: a message was queued with queue_message()
+ * ret: IO_DONE when the whole message was sent, IO_AGAIN if the socket is full,
+ * 	IO_FAILED on error
+ * post: a fully sent payload is freed if the writer owned it
+ */
+static int flush_writer(struct session* session) {
+	struct writer* writer = &session->writer;
+	struct iovec parts[3];
+	struct msghdr msg;
+	size_t total;
+	size_t skip;
+	size_t offset;
+	ssize_t n;
+	int count;
+
+	total = writer->prefix_length + writer->payload_length + writer->suffix_length;
+	while(writer->sent < total) {
+		/*Point the iovecs at whatever is left of prefix, payload and suffix */
+		count = 0;
+		skip = writer->sent;
+		offset = 0;
+		if(skip < writer->prefix_length) {
+			parts[count].iov_base = writer->prefix + skip;
+			parts[count].iov_len = writer->prefix_length - skip;
+			count++;
+			skip = 0;
+		} else {
+			skip -= writer->prefix_length;
+		}
+		if(skip < writer->payload_length) {
+			parts[count].iov_base = writer->payload + skip;
+			parts[count].iov_len = writer->payload_length - skip;
+			count++;
+			skip = 0;
+		} else {
+			skip -= writer->payload_length;
+		}
+		if(skip < writer->suffix_length) {
+			offset = skip;
+			parts[count].iov_base = (char*)writer->suffix + offset;
+			parts[count].iov_len = writer->suffix_length - offset;
+			count++;
+		}
+
+		memset(&msg, '\0', sizeof(msg));
+		msg.msg_iov = parts;
+		msg.msg_iovlen = count;
+		n = sendmsg(session->socket, &msg, MSG_NOSIGNAL);
+		if(n == -1) {
+			if(errno == EINTR) { continue; }
+			if(errno == EAGAIN || errno == EWOULDBLOCK) { return IO_AGAIN; }
+			return IO_FAILED;
+		}
+		writer->sent += n;
+	}
+
+	if(writer->owns_payload) { free(writer->payload); }
+	writer->payload = NULL;
+	writer->owns_payload = 0;
+	return IO_DONE;
+}
+
+/* session_init: starts a session on a freshly accepted socket
+ * args: [1] session: session to initialize
+ * 	[2] socket: the accepted connection
+ * 	[3] service: what to do with the client's messages
+ * pre: nothing has been read from the socket yet
+ * ret: none
+ * post: session is in STATE_NEGOTIATE and must be released with session_free()
+ */
+void session_init(struct session* session, int socket, const struct service* service) {
+	memset(session, '\0', sizeof(*session));
+	session->socket = socket;
+	session->state = STATE_NEGOTIATE;
+	session->service = service;
+	reader_init(&session->reader, OTP_WIRE_LEGACY);
+}
+
+/* session_free: releases a session's buffers
+ * args: [1] session: session to release
+ * pre: session was initialized with session_init()
+ * ret: none
+ * post: the socket is NOT closed; that is up to the caller
+ */
+void session_free(struct session* session) {
+	reader_free(&session->reader);
+	if(session->writer.owns_payload) { free(session->writer.payload); }
+	session->writer.payload = NULL;
+	session->writer.owns_payload = 0;
+	free(session->data);
+	free(session->key);
+	session->data = NULL;
+	session->key = NULL;
+}
+
+/* finish_response: queues the last response of a session
+ * args: [1] session: the session
+ * 	[2] type, [3] payload, [4] length, [5] owned: as for queue_message()
+ * pre: none
+ * ret: none
+ * post: once the response is flushed the session half-closes and drains
+ */
+static void finish_response(struct session* session, int type, char* payload, size_t length, int owned) {
+	queue_message(session, type, payload, length, owned);
+	session->state = STATE_SEND;
+	session->after_send = STATE_DRAIN;
+}
+
+/* session_step: advances a session as far as its socket allows
+ * args: [1] session: the session
+ * pre: session was initialized with session_init()
+ * ret: SESSION_WANT_READ or SESSION_WANT_WRITE if the socket must become readable or
+ * 	writable before the session can go on, SESSION_FINISHED once the connection is done
+ * post: for a blocking socket this only returns early if a receive timeout expired
+ */
+int session_step(struct session* session) {
+	char* message;
+	char* result;
+	char first;
+	char discard[512];
+	size_t length;
+	size_t got;
+	int type;
+	int status;
+
+	while(1) {
+		switch(session->state) {
+		case STATE_NEGOTIATE:
+			/*Find out whether the client speaks frames or the old "@@@" protocol */
+			status = receive_some(session->socket, &first, 1, &got);
+			if(status == IO_AGAIN) { return SESSION_WANT_READ; }
+			if(status == IO_FAILED) { session->state = STATE_CLOSED; break; }
+
+			if(first == OTP_WIRE_V1) {
+				session->wire = OTP_WIRE_V1;
+				reader_init(&session->reader, OTP_WIRE_V1);
+			} else {
+				/*Legacy clients start straight away with their name, so keep the byte */
+				session->wire = OTP_WIRE_LEGACY;
+				session->reader.buffer = malloc(1024);
+				if(session->reader.buffer == NULL) { session->state = STATE_CLOSED; break; }
+				session->reader.buffer[0] = first;
+				session->reader.length = 1;
+				session->reader.capacity = 1024;
+			}
+			session->state = STATE_HELLO;
+			break;
+
+		case STATE_HELLO:
+			status = reader_next(&session->reader, session->socket, &message, &length, &type);
+			if(status == IO_AGAIN) { return SESSION_WANT_READ; }
+			if(status == IO_FAILED) { session->state = STATE_CLOSED; break; }
+
+			/*If the other process is not the expected client, reject it */
+			if((session->wire == OTP_WIRE_V1 && type != OTP_FRAME_HELLO) ||
+				strstr(message, session->service->client_name) == NULL) {
+				finish_response(session, OTP_FRAME_BAD, "BAD", 3, 0);
+			} else {
+				/*Otherwise tell the client it is okay to proceed */
+				queue_message(session, OTP_FRAME_GOOD, "GOOD", 4, 0);
+				session->state = STATE_SEND;
+				session->after_send = STATE_DATA;
+			}
+			free(message);
+			break;
+
+		case STATE_DATA:
+		case STATE_KEY:
+			status = reader_next(&session->reader, session->socket, &message, &length, &type);
+			if(status == IO_AGAIN) { return SESSION_WANT_READ; }
+			if(status == IO_FAILED) { session->state = STATE_CLOSED; break; }
+
+			if(session->state == STATE_DATA) {
+				if(session->wire == OTP_WIRE_V1 && type != OTP_FRAME_DATA) {
+					free(message);
+					session->state = STATE_CLOSED;
+					break;
+				}
+				session->data = message;
+				session->data_length = length;
+				session->state = STATE_KEY;
+			} else {
+				if(session->wire == OTP_WIRE_V1 && type != OTP_FRAME_KEY) {
+					free(message);
+					session->state = STATE_CLOSED;
+					break;
+				}
+				session->key = message;
+				session->key_length = length;
+				session->state = STATE_CIPHER;
+			}
+			break;
+
+		case STATE_CIPHER:
+			/*A key shorter than the data cannot be used; drop the client */
+			if(session->key_length < session->data_length) {
+				session->state = STATE_CLOSED;
+				break;
+			}
+			result = session->service->cipher(session->data, session->key);
+			free(session->data);
+			free(session->key);
+			session->data = NULL;
+			session->key = NULL;
+			if(result == NULL) { session->state = STATE_CLOSED; break; }
+			finish_response(session, OTP_FRAME_RESULT, result, strlen(result), 1);
+			break;
+
+		case STATE_SEND:
+			status = flush_writer(session);
+			if(status == IO_AGAIN) { return SESSION_WANT_WRITE; }
+			if(status == IO_FAILED) { session->state = STATE_CLOSED; break; }
+
+			/*Half-close after the last response: the client sees EOF right after it */
+			if(session->after_send == STATE_DRAIN) {
+				shutdown(session->socket, SHUT_WR);
+			}
+			session->state = session->after_send;
+			break;
+
+		case STATE_DRAIN:
+			/*Wait for the client to close its end, throwing away anything it sends,
+ * 				so closing our end can never reset the connection under the response */
+			do {
+				status = receive_some(session->socket, discard, sizeof(discard), &got);
+			} while(status == IO_DONE);
+			if(status == IO_AGAIN) { return SESSION_WANT_READ; }
+			session->state = STATE_CLOSED;
+			break;
+
+		case STATE_CLOSED:
+			return SESSION_FINISHED;
+		}
+	}
+}
+
+/* session_run: drives a session to completion on a blocking socket
+ * args: [1] session: the session
+ * pre: session->socket is in blocking mode
+ * ret: none
+ * post: the session is finished, or gave up because a receive timeout expired
+ */
+void session_run(struct session* session) {
+	while(session_step(session) != SESSION_FINISHED) {
+		/*A blocking socket only comes back early when SO_RCVTIMEO/SO_SNDTIMEO expire */
+		session->state = STATE_CLOSED;
+	}
+}
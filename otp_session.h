@@ -0,0 +1,96 @@
+/* Filename: otp_session.h
+ * Author: Howard Chen
+ * Date: 8-9-2017
+ * Description: The per-connection protocol state machine run by otp_enc_d and otp_dec_d.
+ *
+ * 		A session moves through these states:
+ * 			NEGOTIATE -> HELLO -> DATA -> KEY -> CIPHER -> SEND -> DRAIN -> CLOSED
+ * 		A rejected client goes HELLO -> SEND (BAD) -> DRAIN -> CLOSED instead.
+ *
+ * 		Message boundaries come only from the protocol: frame lengths, or the "@@@"
+ * 		terminator for legacy clients. After the response is sent the daemon half-closes
+ * 		the socket with shutdown(SHUT_WR) and waits for the client to close its end, so
+ * 		no sleeps are needed to keep the response from being cut off.
+ *
+ * 		session_step() never blocks by itself. It does as much I/O as the socket allows
+ * 		and reports what it is waiting for, so the same code can be driven by a blocking
+ * 		child process or by an event loop.
+ */
+
+#ifndef OTP_SESSION_H
+#define OTP_SESSION_H
+
+#include <stddef.h>
+
+#include "otp_proto.h"
+
+/*Return values of session_step() */
+#define SESSION_FINISHED 0
+#define SESSION_WANT_READ 1
+#define SESSION_WANT_WRITE 2
+
+enum session_state {
+	STATE_NEGOTIATE,	/*waiting for the negotiation byte */
+	STATE_HELLO,		/*waiting for the client's name */
+	STATE_DATA,		/*waiting for the plaintext or ciphertext */
+	STATE_KEY,		/*waiting for the key */
+	STATE_CIPHER,		/*both halves received, run the cipher */
+	STATE_SEND,		/*flushing a response */
+	STATE_DRAIN,		/*response sent and write side shut down, waiting for EOF */
+	STATE_CLOSED		/*nothing left to do, the socket can be closed */
+};
+
+/* What a daemon does with the messages it receives */
+struct service {
+	const char* client_name;		/*only clients announcing this name are accepted */
+	char* (*cipher)(char* data, char* key);	/*returns a heap string the session frees */
+};
+
+/* Assembles one message at a time from a socket, in either wire mode */
+struct reader {
+	int wire;
+	unsigned char header[OTP_FRAME_HEADER_LEN];
+	size_t header_got;
+	struct frame_header frame;
+	char* buffer;
+	size_t length;
+	size_t capacity;
+	size_t scanned;
+};
+
+/* Holds one outgoing message until the socket has taken all of it */
+struct writer {
+	unsigned char prefix[OTP_FRAME_HEADER_LEN];
+	size_t prefix_length;
+	char* payload;
+	size_t payload_length;
+	int owns_payload;
+	const char* suffix;
+	size_t suffix_length;
+	size_t sent;
+};
+
+struct session {
+	int socket;
+	enum session_state state;
+	enum session_state after_send;
+	int wire;
+	const struct service* service;
+	struct reader reader;
+	struct writer writer;
+	char* data;
+	size_t data_length;
+	char* key;
+	size_t key_length;
+};
+
+void reader_init(struct reader* reader, int wire);
+int reader_next(struct reader* reader, int socket, char** message, size_t* length, int* type);
+void reader_free(struct reader* reader);
+
+void session_init(struct session* session, int socket, const struct service* service);
+int session_step(struct session* session);
+void session_run(struct session* session);
+void session_free(struct session* session);
+
+#endif